@@ -1,35 +1,87 @@
 #include <linux/module.h>
+#include <linux/version.h>
 
 #include <net/cfg80211.h> /*wiphy stuff?*/
 #include <linux/skbuff.h>
+#include <linux/etherdevice.h>
+#include <linux/rtnetlink.h>
 
 #include <linux/workqueue.h>
 #include <linux/semaphore.h>
 
-#define WIPHY_NAME "navifly"
+#define WIPHY_NAME "navifly%d"
 #define NDEV_NAME "navifly%d"
 #define SSID_DUMMY "NaviflyWIFI"
-#define SSID_DUMMY_SIZE (sizeof(SSID_DUMMY) - 1)
+#define NVF_MAX_BSS 64
+#define NVF_MAX_IFACES 256 /* per radio, numbered in the last address byte */
+
+/* number of radios, each one wiphy that starts with one station interface,
+ * more can be added with iw phy <wiphy> interface add */
+static int radios = 1;
+module_param(radios, int, 0444);
+MODULE_PARM_DESC(radios, "number of simulated radios (wiphys)");
+
+/* the access points every radio sees, as ssid/bssid/channel/dBm, e.g.
+ * bss=home/02:00:00:00:00:01/6/-45,office/02:00:00:00:00:02/11/-70
+ * the last three fields are taken from the end, the ssid may hold a '/' */
+static char *bss[NVF_MAX_BSS];
+static int bss_entries;
+module_param_array(bss, charp, &bss_entries, 0444);
+MODULE_PARM_DESC(bss, "simulated BSSes, ssid/bssid/channel/dBm");
+
+/* without a bss table this many are made up: NaviflyWIFI, NaviflyWIFI-1,
+ * NaviflyWIFI-2, ... spread over the channels */
+static int bss_count = 1;
+module_param(bss_count, int, 0444);
+MODULE_PARM_DESC(bss_count, "number of generated BSSes when bss is not given");
+
+/* a simulated access point */
+struct navifly_bss {
+	u8 ssid[IEEE80211_MAX_SSID_LEN];
+	u8 ssid_len;
+	u8 bssid[ETH_ALEN];
+	int channel;
+	int signal; /* mBm */
+};
+
+/* built at load time and read-only after, shared by all radios */
+static struct navifly_bss *nvf_bss;
+static unsigned int nvf_n_bss;
 
+/* one radio: a wiphy, its interfaces and the scan it runs for them */
 struct navifly_context {
 	struct wiphy *wiphy; /* physical device, list with iw list */
-	struct net_device *ndev; /* network devices */
+	struct list_head ifaces; /* network devices, under RTNL */
+	DECLARE_BITMAP(addrs, NVF_MAX_IFACES); /* address numbers in use, under RTNL */
 	struct semaphore sem;
-	struct work_struct ws_connect;
-	char connecting_ssid[sizeof(SSID_DUMMY)];
-	struct work_struct ws_disconnect;
-	u16 disconnect_reason_code;
 	struct work_struct ws_scan;
 	struct cfg80211_scan_request *scan_request;
+	/* cfg80211 keeps per wiphy state in the channels, so each radio
+	 * has its own copy of the band */
+	struct ieee80211_supported_band band;
+	struct ieee80211_channel channels[13];
+	struct ieee80211_rate rates[4];
 };
 
 struct navifly_wiphy_priv_context {
 	struct navifly_context *navi;
 };
 
+/* one station interface of a radio, connects on its own */
 struct navifly_ndev_priv_context {
 	struct navifly_context *navi;
 	struct wireless_dev wdev; /* this and ndev represent physical device */
+	struct net_device *ndev;
+	struct list_head list;
+	unsigned int addr_idx; /* last byte of its address */
+	struct work_struct ws_connect;
+	u8 connecting_ssid[IEEE80211_MAX_SSID_LEN];
+	u8 connecting_ssid_len;
+	u8 connecting_bssid[ETH_ALEN];
+	bool connecting_any_bssid;
+	struct work_struct ws_disconnect;
+	u16 disconnect_reason_code;
+	bool removing; /* no more work queued, under sem */
 };
 
 /* get priv context from wiphy ds*/
@@ -46,35 +98,33 @@ static struct navifly_ndev_priv_context
 	return (struct navifly_ndev_priv_context *)netdev_priv(ndev);
 }
 
-/* prepare a dummy BSS response for system
+/* prepare a BSS response for system
  * cfg80211_inform_bss_data cotnain information for basic service set: channel,
  * signal strength etc.
- * inform kernel about new bss
+ * inform kernel about new bss, the caller owns the returned reference
  */
-static void inform_dummy_bss(struct navifly_context *navi)
+static struct cfg80211_bss *navifly_inform_bss(struct navifly_context *navi,
+					       const struct navifly_bss *b)
 {
-	struct cfg80211_bss *bss = NULL;
+	int freq = ieee80211_channel_to_frequency(b->channel, NL80211_BAND_2GHZ);
 	struct cfg80211_inform_bss data = {
-		.chan = &navi->wiphy->bands[NL80211_BAND_2GHZ]->channels[0],
+		.chan = ieee80211_get_channel(navi->wiphy, freq),
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,7,0)
 		.scan_width = NL80211_BSS_CHAN_WIDTH_20,
-		/* signal "type" not specified can be a % 0-100 or mBm
-		 * before wiphy registration using .signal_type*/
-		.signal = 1337,
+#endif
+		/* in mBm, as set with .signal_type before wiphy registration */
+		.signal = b->signal,
 	};
-	char bssid[6] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
 	/* array of tags obtained from beacon frame or probe response */
-	char ie[SSID_DUMMY_SIZE + 2] = {WLAN_EID_SSID, SSID_DUMMY_SIZE}; /*informatio element packs ssid it is a  frame taken from wifi management frame*/
-	memcpy(ie + 2, SSID_DUMMY, SSID_DUMMY_SIZE);
+	u8 ie[IEEE80211_MAX_SSID_LEN + 2] = {WLAN_EID_SSID, b->ssid_len}; /*informatio element packs ssid it is a  frame taken from wifi management frame*/
+
+	memcpy(ie + 2, b->ssid, b->ssid_len);
 	/* bss known to the systems*/
 	/* can use cfg80211_inform_bss() instead */
-	bss = cfg80211_inform_bss_data(navi->wiphy, &data,
-				       CFG80211_BSS_FTYPE_UNKNOWN, bssid, 0,
-				       WLAN_CAPABILITY_ESS, 100, ie, sizeof(ie),
-				       GFP_KERNEL);
-	/*since bss is no longer needed, put it back to avoid memory leak*/
-	/* returning cfg80211_bss ds refcounter, to be decremented if not used
-	 * */
-	cfg80211_put_bss(navi->wiphy, bss);
+	return cfg80211_inform_bss_data(navi->wiphy, &data,
+					CFG80211_BSS_FTYPE_UNKNOWN, b->bssid, 0,
+					WLAN_CAPABILITY_ESS, 100, ie,
+					b->ssid_len + 2, GFP_KERNEL);
 }
 
 /* bss data can be obtained from cfg80211_inform_bss()
@@ -85,21 +135,29 @@ static void inform_dummy_bss(struct navifly_context *navi)
  * called through workqueue, when kernel asks about cfg80211_ops*/
 static void navifly_scan_routine(struct work_struct *w)
 {
-	struct navifly_context *navi = container_of(w, struct navifly_context, ws_scan); 
+	struct navifly_context *navi = container_of(w, struct navifly_context, ws_scan);
 	struct cfg80211_scan_info info = {
 		/* set true if user aborts or hw issues */
 		.aborted = false,
 	};
+	unsigned int i;
+
 	/* seems like a bug where cfg80211_ops->scan() can't be called before
 	 * scan_done immediately */
 	msleep(100);
-	inform_dummy_bss(navi);
+	/*since bss is no longer needed, put it back to avoid memory leak*/
+	for (i = 0; i < nvf_n_bss; i++) {
+		cfg80211_put_bss(navi->wiphy, navifly_inform_bss(navi, &nvf_bss[i]));
+	}
 	if (down_interruptible(&navi->sem)) {
 	    return;
 	}
-	
-	cfg80211_scan_done(navi->scan_request, &info);
-	navi->scan_request = NULL;
+
+	/* may have been aborted meanwhile, see navifly_abort_scan() */
+	if (navi->scan_request != NULL) {
+		cfg80211_scan_done(navi->scan_request, &info);
+		navi->scan_request = NULL;
+	}
 	up(&navi->sem);
 }
 
@@ -111,23 +169,43 @@ static void navifly_scan_routine(struct work_struct *w)
  */
 static void navifly_connect_routine(struct work_struct *w)
 {
-	struct navifly_context *navi = container_of(w,
-						    struct navifly_context,
+	struct navifly_ndev_priv_context *vif = container_of(w,
+						    struct navifly_ndev_priv_context,
 						    ws_connect);
+	struct navifly_context *navi = vif->navi;
+	const struct navifly_bss *best = NULL;
+	unsigned int i;
+
 	if (down_interruptible(&navi->sem)) {
 		return;
 	    }
-	if (memcmp(navi->connecting_ssid, SSID_DUMMY, sizeof(SSID_DUMMY))!= 0) {
-		cfg80211_connect_timeout(navi->ndev, NULL, NULL, 0, GFP_KERNEL,
+	/* the strongest AP with that name, unless one was asked for */
+	for (i = 0; i < nvf_n_bss; i++) {
+		const struct navifly_bss *b = &nvf_bss[i];
+
+		if (b->ssid_len != vif->connecting_ssid_len ||
+		    memcmp(b->ssid, vif->connecting_ssid, b->ssid_len) != 0) {
+			continue;
+		}
+		if (!vif->connecting_any_bssid &&
+		    !ether_addr_equal(b->bssid, vif->connecting_bssid)) {
+			continue;
+		}
+		if (best == NULL || b->signal > best->signal) {
+			best = b;
+		}
+	}
+	if (best == NULL) {
+		cfg80211_connect_timeout(vif->ndev, NULL, NULL, 0, GFP_KERNEL,
 					 NL80211_TIMEOUT_SCAN);
 	} else {
-		/* send dummy bss to kernel */
-		inform_dummy_bss(navi);
-		cfg80211_connect_bss(navi->ndev,  NULL, NULL, NULL, 0, NULL, 0,
-				     WLAN_STATUS_SUCCESS, GFP_KERNEL,
+		/* send the bss to kernel, which takes over our reference */
+		cfg80211_connect_bss(vif->ndev, best->bssid,
+				     navifly_inform_bss(navi, best), NULL, 0,
+				     NULL, 0, WLAN_STATUS_SUCCESS, GFP_KERNEL,
 				     NL80211_TIMEOUT_UNSPECIFIED);
 	}
-	navi->connecting_ssid[0] = 0;
+	vif->connecting_ssid_len = 0;
 	up(&navi->sem);
 }
 
@@ -137,14 +215,17 @@ static void navifly_connect_routine(struct work_struct *w)
  *  called rorm disconnect work_queue through cfg802011_ops*/
 static void navifly_disconnect_routine(struct work_struct *w)
 {
-	struct navifly_context *navi = container_of(w, struct navifly_context,
+	struct navifly_ndev_priv_context *vif = container_of(w,
+						    struct navifly_ndev_priv_context,
 						    ws_disconnect);
+	struct navifly_context *navi = vif->navi;
+
 	if (down_interruptible(&navi->sem)) {
 		return;
 	}
-	cfg80211_disconnected(navi->ndev, navi->disconnect_reason_code, NULL,
+	cfg80211_disconnected(vif->ndev, vif->disconnect_reason_code, NULL,
 			      0 , true, GFP_KERNEL);
-	navi->disconnect_reason_code = 0;
+	vif->disconnect_reason_code = 0;
 	up(&navi->sem);
 }
 
@@ -152,17 +233,24 @@ static void navifly_disconnect_routine(struct work_struct *w)
  * disconnection completion */
 static int nvf_disconnect(struct wiphy *wiphy, struct net_device *dev, u16 reason_code)
 {
-	struct navifly_context *navi = wiphy_get_navi_context(wiphy)->navi;
+	struct navifly_ndev_priv_context *vif = ndev_get_navi_context(dev);
+	struct navifly_context *navi = vif->navi;
 
 	if (down_interruptible(&navi->sem)) {
                   return -ERESTARTSYS;
               }
 
-	navi->disconnect_reason_code = reason_code;
+	/* cfg80211 disconnects an interface that goes away, which
+	 * navifly_del_iface() has already taken care of */
+	if (vif->removing) {
+		up(&navi->sem);
+		return 0;
+	}
+	vif->disconnect_reason_code = reason_code;
 
 	up(&navi->sem);
 
-	if (!schedule_work(&navi->ws_disconnect)) {
+	if (!schedule_work(&vif->ws_disconnect)) {
 		return -EBUSY;
 	}
 	return 0;
@@ -179,9 +267,10 @@ static int nvf_connect(struct wiphy *wiphy, struct net_device *dev,
 		       struct cfg80211_connect_params *sme)
 {
 	/* sme struct contains a other information about connection, but we are
-	 * only using ssid */
-	struct navifly_context *navi = wiphy_get_navi_context(wiphy)->navi;
-	size_t ssid_len = sme->ssid_len > 15 ? 15: sme->ssid_len;
+	 * only using ssid and bssid */
+	struct navifly_ndev_priv_context *vif = ndev_get_navi_context(dev);
+	struct navifly_context *navi = vif->navi;
+	size_t ssid_len = min_t(size_t, sme->ssid_len, IEEE80211_MAX_SSID_LEN);
 
 	if (sme->ssid == NULL || sme->ssid_len == 0) {
 		return -EBUSY;
@@ -191,12 +280,20 @@ static int nvf_connect(struct wiphy *wiphy, struct net_device *dev,
 	    return -ERESTARTSYS;
 	}
 
-	memcpy(navi->connecting_ssid, sme->ssid, ssid_len);
-	navi->connecting_ssid[ssid_len] = 0; /* nul terminate */
+	if (vif->removing) {
+		up(&navi->sem);
+		return -ENETDOWN;
+	}
+	memcpy(vif->connecting_ssid, sme->ssid, ssid_len);
+	vif->connecting_ssid_len = ssid_len;
+	vif->connecting_any_bssid = sme->bssid == NULL;
+	if (sme->bssid != NULL) {
+		memcpy(vif->connecting_bssid, sme->bssid, ETH_ALEN);
+	}
 
 	up(&navi->sem);
 
-	if (!schedule_work(&navi->ws_connect)) {
+	if (!schedule_work(&vif->ws_connect)) {
 		return -EBUSY;
 	}
 	return 0;
@@ -218,6 +315,12 @@ static int nvf_scan(struct wiphy *wiphy, struct cfg80211_scan_request *request)
 		up(&navi->sem);
 		return -EBUSY;
 	}
+	/* all wdevs of our wiphys are ours */
+	if (container_of(request->wdev, struct navifly_ndev_priv_context,
+			 wdev)->removing) {
+		up(&navi->sem);
+		return -ENETDOWN;
+	}
 	navi->scan_request = request;
 	up(&navi->sem);
 	/* we request ws_scan, which executes navifly_scan_routine */
@@ -228,16 +331,6 @@ static int nvf_scan(struct wiphy *wiphy, struct cfg80211_scan_request *request)
 	return 0;
 }
 
-/* functions needs for fullMAc driver
- * to be implemented with wiphy struct fields
- * connect and disconnect are always in pair
- */
-static const struct cfg80211_ops nvf_cfg_ops = {
-	.scan = nvf_scan,
-	.connect = nvf_connect,
-	.disconnect = nvf_disconnect,
-};
-
 /* transmit function for network packets */
 static netdev_tx_t nvf_ndo_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
@@ -251,17 +344,200 @@ static const struct net_device_ops nvf_ndev_ops = {
 	.ndo_start_xmit = nvf_ndo_start_xmit,
 };
 
-/* Supported channels, required for wiphy */
-static struct ieee80211_channel nvf_supported_channel_2ghz[] = {
-	{
-		.band = NL80211_BAND_2GHZ,
-		.hw_value = 0,
-		.center_freq = 2437,
+/* interfaces come and go under RTNL, and from 5.12 with the wiphy locked
+ * as well, which cfg80211 does around add/del_virtual_intf */
+static void navifly_lock(struct navifly_context *navi)
+{
+	rtnl_lock();
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+	wiphy_lock(navi->wiphy);
+#endif
+}
+
+static void navifly_unlock(struct navifly_context *navi)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+	wiphy_unlock(navi->wiphy);
+#endif
+	rtnl_unlock();
+}
+
+/* finish the scan of an interface that goes away, cfg80211 frees the
+ * request with it */
+static void navifly_abort_scan(struct navifly_context *navi,
+			       struct wireless_dev *wdev)
+{
+	struct cfg80211_scan_info info = {
+		.aborted = true,
+	};
+
+	cancel_work_sync(&navi->ws_scan);
+	down(&navi->sem);
+	if (navi->scan_request != NULL && navi->scan_request->wdev == wdev) {
+		cfg80211_scan_done(navi->scan_request, &info);
+		navi->scan_request = NULL;
+	} else if (navi->scan_request != NULL) {
+		/* another interface's scan, put it back */
+		schedule_work(&navi->ws_scan);
+	}
+	up(&navi->sem);
+}
+
+/* create a station interface on a radio, called locked */
+static struct navifly_ndev_priv_context *navifly_add_iface(struct navifly_context *navi,
+							   const char *name,
+							   unsigned char name_assign_type)
+{
+	struct navifly_ndev_priv_context *vif = NULL;
+	struct net_device *ndev = NULL;
+	unsigned int addr_idx;
+	u8 addr[ETH_ALEN];
+	int err;
+
+	/* a free number for the address, which ends the radio address */
+	addr_idx = find_first_zero_bit(navi->addrs, NVF_MAX_IFACES);
+	if (addr_idx >= NVF_MAX_IFACES) {
+		return ERR_PTR(-ENOSPC);
+	}
+
+	ndev = alloc_netdev(sizeof(struct navifly_ndev_priv_context), name,
+			    name_assign_type, ether_setup);
+	if (ndev == NULL) {
+		return ERR_PTR(-ENOMEM);
 	}
+
+	/* set private data structure */
+	vif = ndev_get_navi_context(ndev);
+	vif->navi = navi;
+	vif->ndev = ndev;
+	/* wireless_dev with net_device can be represented as interited class of
+	 * single net device */
+	vif->wdev.wiphy = navi->wiphy;
+	vif->wdev.netdev = ndev;
+	vif->wdev.iftype = NL80211_IFTYPE_STATION;
+	ndev->ieee80211_ptr = &vif->wdev; /* this is make this device recognised as wifi device */
+	/* implement methods for net_device */
+	ndev->netdev_ops = &nvf_ndev_ops;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+	ndev->needs_free_netdev = true;
+#else
+	ndev->destructor = free_netdev;
+#endif
+	INIT_WORK(&vif->ws_connect, navifly_connect_routine);
+	INIT_WORK(&vif->ws_disconnect, navifly_disconnect_routine);
+
+	/* the radio address, with the interface number in the last byte */
+	vif->addr_idx = addr_idx;
+	memcpy(addr, navi->wiphy->perm_addr, ETH_ALEN);
+	addr[ETH_ALEN - 1] = addr_idx;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,15,0)
+	eth_hw_addr_set(ndev, addr);
+#else
+	memcpy(ndev->dev_addr, addr, ETH_ALEN);
+#endif
+
+	/* register the network device */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+	err = cfg80211_register_netdevice(ndev);
+#else
+	err = register_netdevice(ndev);
+#endif
+	if (err) {
+		free_netdev(ndev);
+		return ERR_PTR(err);
+	}
+	set_bit(addr_idx, navi->addrs);
+	list_add_tail(&vif->list, &navi->ifaces);
+	return vif;
+}
+
+/* remove a station interface, called locked; the net_device is freed
+ * once RTNL is released. Its work is stopped before cfg80211 lets go of
+ * the wdev, so no connect result or bss reference is handed to it after */
+static void navifly_del_iface(struct navifly_ndev_priv_context *vif)
+{
+	struct navifly_context *navi = vif->navi;
+
+	down(&navi->sem);
+	vif->removing = true;
+	up(&navi->sem);
+	cancel_work_sync(&vif->ws_connect);
+	cancel_work_sync(&vif->ws_disconnect);
+	navifly_abort_scan(navi, &vif->wdev);
+	list_del(&vif->list);
+	clear_bit(vif->addr_idx, navi->addrs);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+	cfg80211_unregister_netdevice(vif->ndev);
+#else
+	unregister_netdevice(vif->ndev);
+#endif
+}
+
+/* iw phy <wiphy> interface add <name> type managed */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,12,0)
+static struct wireless_dev *nvf_add_virtual_intf(struct wiphy *wiphy,
+						 const char *name,
+						 unsigned char name_assign_type,
+						 enum nl80211_iftype type,
+						 struct vif_params *params)
+#else
+static struct wireless_dev *nvf_add_virtual_intf(struct wiphy *wiphy,
+						 const char *name,
+						 unsigned char name_assign_type,
+						 enum nl80211_iftype type,
+						 u32 *flags,
+						 struct vif_params *params)
+#endif
+{
+	struct navifly_ndev_priv_context *vif = NULL;
+
+	if (type != NL80211_IFTYPE_STATION) {
+		return ERR_PTR(-EOPNOTSUPP);
+	}
+	vif = navifly_add_iface(wiphy_get_navi_context(wiphy)->navi, name,
+				name_assign_type);
+	if (IS_ERR(vif)) {
+		return ERR_CAST(vif);
+	}
+	return &vif->wdev;
+}
+
+/* iw dev <name> del */
+static int nvf_del_virtual_intf(struct wiphy *wiphy, struct wireless_dev *wdev)
+{
+	navifly_del_iface(ndev_get_navi_context(wdev->netdev));
+	return 0;
+}
+
+/* functions needs for fullMAc driver
+ * to be implemented with wiphy struct fields
+ * connect and disconnect are always in pair
+ */
+static const struct cfg80211_ops nvf_cfg_ops = {
+	.add_virtual_intf = nvf_add_virtual_intf,
+	.del_virtual_intf = nvf_del_virtual_intf,
+	.scan = nvf_scan,
+	.connect = nvf_connect,
+	.disconnect = nvf_disconnect,
+};
+
+#define NVF_CHAN_2GHZ(_ch) {				\
+	.band = NL80211_BAND_2GHZ,			\
+	.hw_value = (_ch),				\
+	.center_freq = 2407 + 5 * (_ch),		\
+}
+
+/* Supported channels, required for wiphy, copied for every radio */
+static const struct ieee80211_channel nvf_supported_channel_2ghz[] = {
+	NVF_CHAN_2GHZ(1), NVF_CHAN_2GHZ(2), NVF_CHAN_2GHZ(3),
+	NVF_CHAN_2GHZ(4), NVF_CHAN_2GHZ(5), NVF_CHAN_2GHZ(6),
+	NVF_CHAN_2GHZ(7), NVF_CHAN_2GHZ(8), NVF_CHAN_2GHZ(9),
+	NVF_CHAN_2GHZ(10), NVF_CHAN_2GHZ(11), NVF_CHAN_2GHZ(12),
+	NVF_CHAN_2GHZ(13),
 };
 
 /* supported rates  for 2ghz band*/
-static struct ieee80211_rate nvf_supported_rates_2ghz[] = {
+static const struct ieee80211_rate nvf_supported_rates_2ghz[] = {
 	{
 		.bitrate = 10,
 		.hw_value = 0x1,
@@ -281,50 +557,61 @@ static struct ieee80211_rate nvf_supported_rates_2ghz[] = {
 };
 
 /* supported bands */
-static struct ieee80211_supported_band nvf_band_2ghz = {
+static const struct ieee80211_supported_band nvf_band_2ghz = {
 	.ht_cap.cap = IEEE80211_HT_CAP_SGI_20,
 	.ht_cap.ht_supported = false,
 
-	.channels = nvf_supported_channel_2ghz,
 	.n_channels = ARRAY_SIZE(nvf_supported_channel_2ghz),
-
-	.bitrates = nvf_supported_rates_2ghz,
 	.n_bitrates = ARRAY_SIZE(nvf_supported_rates_2ghz),
-
 };
 
 /* on unloading the device, it will clean the context
- * virtual device will also disappear */
+ * virtual devices will also disappear */
 static void navifly_free(struct navifly_context *ctx)
 {
+	struct navifly_ndev_priv_context *vif, *tmp;
+
 	if (ctx == NULL) {
 		return;
 	}
-	unregister_netdev(ctx->ndev);
-	free_netdev(ctx->ndev);
+	navifly_lock(ctx);
+	list_for_each_entry_safe(vif, tmp, &ctx->ifaces, list) {
+		navifly_del_iface(vif);
+	}
+	navifly_unlock(ctx);
+	cancel_work_sync(&ctx->ws_scan);
 	wiphy_unregister(ctx->wiphy);
 	wiphy_free(ctx->wiphy);
 	kfree(ctx);
  }
 
-/* create context for wiphy & net_device with wireless_dev
+/* create context for wiphy number idx, with its first net_device
  *  these interfaces are used by kernel to interact with driver */
-static struct navifly_context *navifly_create_context(void)
+static struct navifly_context *navifly_create_context(int idx)
 {
 	struct navifly_context *ret = NULL;
 	struct navifly_wiphy_priv_context *wiphy_data = NULL;
-	struct navifly_ndev_priv_context *ndev_data = NULL;
+	struct navifly_ndev_priv_context *vif = NULL;
+	char name[32];
+	int err = -ENOMEM;
+
+	BUILD_BUG_ON(sizeof(ret->channels) != sizeof(nvf_supported_channel_2ghz));
+	BUILD_BUG_ON(sizeof(ret->rates) != sizeof(nvf_supported_rates_2ghz));
 
-	ret = kmalloc(sizeof(struct navifly_context), GFP_KERNEL);
+	ret = kzalloc(sizeof(struct navifly_context), GFP_KERNEL);
 	if (!ret) {
 		goto l_error;
 	}
+	INIT_LIST_HEAD(&ret->ifaces);
+	sema_init(&ret->sem, 1);
+	INIT_WORK(&ret->ws_scan, navifly_scan_routine);
 
 	/* wiphy represent physical wireles device
-	 * one wiphy can have multiple interfaces, requires add_virtual_intf()
+	 * one wiphy can have multiple interfaces, through add_virtual_intf()
 	 * in cfg80211_ops.
 	 */
-	ret->wiphy = wiphy_new_nm(&nvf_cfg_ops, sizeof(struct navifly_wiphy_priv_context), WIPHY_NAME);
+	snprintf(name, sizeof(name), WIPHY_NAME, idx);
+	ret->wiphy = wiphy_new_nm(&nvf_cfg_ops, sizeof(struct navifly_wiphy_priv_context), name);
 	if (ret->wiphy == NULL) {
 		goto l_error_wiphy;
 	}
@@ -336,77 +623,183 @@ static struct navifly_context *navifly_create_context(void)
 
 	/* modes supported by device */
 	ret->wiphy->interface_modes = BIT(NL80211_IFTYPE_STATION);
-	/* random channel */
-	ret->wiphy->bands[NL80211_BAND_2GHZ] = &nvf_band_2ghz;
+	/* the 2.4GHz channels, with the rates */
+	memcpy(ret->channels, nvf_supported_channel_2ghz, sizeof(ret->channels));
+	memcpy(ret->rates, nvf_supported_rates_2ghz, sizeof(ret->rates));
+	ret->band = nvf_band_2ghz;
+	ret->band.channels = ret->channels;
+	ret->band.bitrates = ret->rates;
+	ret->wiphy->bands[NL80211_BAND_2GHZ] = &ret->band;
 	/* how many ssids can this device scan */
 	ret->wiphy->max_scan_ssids = 69;
+	/* BSS signal is given in mBm */
+	ret->wiphy->signal_type = CFG80211_SIGNAL_TYPE_MBM;
+	/* 02:4e:46 ("NF", locally administered), the radio number, then
+	 * the interface number */
+	ret->wiphy->perm_addr[0] = 0x02;
+	ret->wiphy->perm_addr[1] = 'N';
+	ret->wiphy->perm_addr[2] = 'F';
+	ret->wiphy->perm_addr[3] = idx >> 8;
+	ret->wiphy->perm_addr[4] = idx;
 
 	/* register physical wireless device, iw list will now show the device
 	 * this has no network interface yet */
-	if (wiphy_register(ret->wiphy) < 0) {
+	err = wiphy_register(ret->wiphy);
+	if (err < 0) {
 		goto l_error_wiphy_register;
 	}
-	/* register network device */
-	ret->ndev = alloc_netdev(sizeof(struct net_device), NDEV_NAME, NET_NAME_ENUM, ether_setup);
-	if (ret->ndev == NULL) {
-		goto l_error_alloc_ndev;
-	}
 
-	/* set private data structure */
-	ndev_data = ndev_get_navi_context(ret->ndev);
-	ndev_data->navi = ret;
-	/* wireless_dev with net_device can be represented as interited class of
-	 * single net device */
-	ndev_data->wdev.wiphy = ret->wiphy;
-	ndev_data->wdev.netdev = ret->ndev;
-	ndev_data->wdev.iftype = NL80211_IFTYPE_STATION;
-	ret->ndev->ieee80211_ptr = &ndev_data->wdev; /* this is make this device recognised as wifi device */
-	/* implement methods for net_device */
-	ret->ndev->netdev_ops = &nvf_ndev_ops;
-
-	/* register the network device */
-	if (register_netdev(ret->ndev)) {
-		goto l_error_ndev_register;
+	/* and the first network device */
+	navifly_lock(ret);
+	vif = navifly_add_iface(ret, NDEV_NAME, NET_NAME_ENUM);
+	navifly_unlock(ret);
+	if (IS_ERR(vif)) {
+		err = PTR_ERR(vif);
+		goto l_error_add_iface;
 	}
 
 	return ret;
 
-l_error_ndev_register:
-	free_netdev(ret->ndev);
-l_error_alloc_ndev:
+l_error_add_iface:
 	wiphy_unregister(ret->wiphy);
 l_error_wiphy_register:
 	wiphy_free(ret->wiphy);
 l_error_wiphy:
 	kfree(ret);
 l_error:
-	return NULL;
+	return ERR_PTR(err);
+
+}
 
+/* parse one ssid/bssid/channel/dBm entry of the bss parameter */
+static int navifly_parse_bss(const char *spec, struct navifly_bss *b)
+{
+	char *s = NULL, *field[3];
+	unsigned int channel;
+	int i, dbm, err = -EINVAL;
+
+	s = kstrdup(spec, GFP_KERNEL);
+	if (s == NULL) {
+		return -ENOMEM;
+	}
+	for (i = 2; i >= 0; i--) {
+		field[i] = strrchr(s, '/');
+		if (field[i] == NULL) {
+			goto l_out;
+		}
+		*field[i]++ = 0;
+	}
+	if (strlen(s) == 0 || strlen(s) > IEEE80211_MAX_SSID_LEN ||
+	    !mac_pton(field[0], b->bssid) ||
+	    kstrtouint(field[1], 0, &channel) ||
+	    channel < 1 || channel > ARRAY_SIZE(nvf_supported_channel_2ghz) ||
+	    kstrtoint(field[2], 0, &dbm)) {
+		goto l_out;
+	}
+	b->ssid_len = strlen(s);
+	memcpy(b->ssid, s, b->ssid_len);
+	b->channel = channel;
+	b->signal = dbm * 100;
+	err = 0;
+l_out:
+	kfree(s);
+	return err;
+}
+
+/* fill nvf_bss from the bss parameter, or make up bss_count of them */
+static int navifly_setup_bss(void)
+{
+	unsigned int i;
+	int err;
+
+	nvf_n_bss = bss_entries ? bss_entries : bss_count;
+	nvf_bss = kcalloc(nvf_n_bss, sizeof(*nvf_bss), GFP_KERNEL);
+	if (nvf_bss == NULL) {
+		return -ENOMEM;
+	}
+	for (i = 0; i < nvf_n_bss; i++) {
+		struct navifly_bss *b = &nvf_bss[i];
+
+		if (bss_entries) {
+			err = navifly_parse_bss(bss[i], b);
+			if (err) {
+				pr_err("virtualwifi: bad bss \"%s\"\n", bss[i]);
+				return err;
+			}
+			continue;
+		}
+		/* the first one is what this driver always showed */
+		if (i == 0) {
+			static const u8 bssid[ETH_ALEN] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+
+			b->ssid_len = snprintf((char *)b->ssid, sizeof(b->ssid), SSID_DUMMY);
+			memcpy(b->bssid, bssid, ETH_ALEN);
+		} else {
+			b->ssid_len = snprintf((char *)b->ssid, sizeof(b->ssid), SSID_DUMMY "-%u", i);
+			b->bssid[0] = 0x02;
+			b->bssid[1] = 'A';
+			b->bssid[2] = 'P';
+			b->bssid[3] = i >> 16;
+			b->bssid[4] = i >> 8;
+			b->bssid[5] = i;
+		}
+		/* 6, 11, 3, 8, 13, 5, ... and -40 to -89 dBm */
+		b->channel = 1 + (5 + 5 * i) % ARRAY_SIZE(nvf_supported_channel_2ghz);
+		b->signal = -4000 - (i % 50) * 100;
+	}
+	return 0;
+}
+
+static struct navifly_context **nvf_radios = NULL;
+
+static void virtual_wifi_cleanup(void)
+{
+	int i;
+
+	if (nvf_radios != NULL) {
+		for (i = radios - 1; i >= 0; i--) {
+			navifly_free(nvf_radios[i]);
+		}
+	}
+	kfree(nvf_radios);
+	kfree(nvf_bss);
 }
-static struct navifly_context *g_ctx = NULL;
 
 static int __init virtual_wifi_init(void)
 {
-	g_ctx = navifly_create_context();
-	if (g_ctx != NULL) {
-		/* adding outside context of navifly, workqueues */
-		sema_init(&g_ctx->sem, 1);
-		INIT_WORK(&g_ctx->ws_connect, navifly_connect_routine);
-		g_ctx->connecting_ssid[0] = 0;
-		INIT_WORK(&g_ctx->ws_disconnect, navifly_disconnect_routine);
-		g_ctx->disconnect_reason_code = 0;
-		INIT_WORK(&g_ctx->ws_scan, navifly_scan_routine);
-		g_ctx->scan_request = NULL;
-	}
-	return g_ctx == NULL;
+	struct navifly_context *navi = NULL;
+	int i, err;
+
+	if (radios < 1 || bss_count < 0) {
+		return -EINVAL;
+	}
+	err = navifly_setup_bss();
+	if (err) {
+		goto l_error;
+	}
+	nvf_radios = kcalloc(radios, sizeof(*nvf_radios), GFP_KERNEL);
+	if (nvf_radios == NULL) {
+		err = -ENOMEM;
+		goto l_error;
+	}
+	for (i = 0; i < radios; i++) {
+		navi = navifly_create_context(i);
+		if (IS_ERR(navi)) {
+			err = PTR_ERR(navi);
+			goto l_error;
+		}
+		nvf_radios[i] = navi;
+	}
+	return 0;
+
+l_error:
+	virtual_wifi_cleanup();
+	return err;
 }
 
 static void __exit virtual_wifi_exit(void)
 {
-	cancel_work_sync(&g_ctx->ws_connect);
-	cancel_work_sync(&g_ctx->ws_disconnect);
-	cancel_work_sync(&g_ctx->ws_scan);
-	navifly_free(g_ctx);
+	virtual_wifi_cleanup();
 }
 
 module_init(virtual_wifi_init);
@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# qemu-bench.sh -- boot an x86 guest and run snull-bench.sh in it
+#
+#   qemu-bench.sh <bzImage> <snull.ko> [report.json]
+#
+# The initramfs is a static busybox, the module, snull-wire-test when
+# it is built and snull-bench.sh as /init, so the guest kernel needs debugfs, page_pool and dimlib built
+# in. The JSON report lands in report.json (bench-report.json by
+# default), the whole console log next to it. Tunables, from the
+# environment:
+#
+#   BUSYBOX      static busybox binary          (busybox on the PATH)
+#   QEMU         the emulator                   (qemu-system-x86_64)
+#   SMP, MEM     guest CPUs and memory          (4, 1024M)
+#   TIMEOUT      seconds before giving up       (600)
+#   SIZES, COUNT, LAT_RATE, LAT_COUNT, MODARGS  see snull-bench.sh
+
+set -e
+
+[ $# -ge 2 ] || { echo "usage: $0 <bzImage> <snull.ko> [report.json]" >&2; exit 2; }
+KERNEL=$1
+MODULE=$2
+REPORT=${3:-bench-report.json}
+LOG=${REPORT%.json}.log
+
+BUSYBOX=${BUSYBOX:-$(command -v busybox || true)}
+QEMU=${QEMU:-qemu-system-x86_64}
+SMP=${SMP:-4}
+MEM=${MEM:-1024M}
+TIMEOUT=${TIMEOUT:-600}
+
+[ -r "$KERNEL" ] || { echo "$0: no kernel image $KERNEL" >&2; exit 1; }
+[ -r "$MODULE" ] || { echo "$0: no module $MODULE" >&2; exit 1; }
+[ -x "$BUSYBOX" ] || { echo "$0: need a static busybox, set BUSYBOX" >&2; exit 1; }
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# the initramfs
+mkdir -p "$WORK/root/bin" "$WORK/root/proc" "$WORK/root/sys" "$WORK/root/dev"
+cp "$BUSYBOX" "$WORK/root/bin/busybox"
+ln -s busybox "$WORK/root/bin/sh"
+cp "$MODULE" "$WORK/root/snull.ko"
+cp "$HERE/snull-bench.sh" "$WORK/root/init"
+[ -x "$HERE/snull-wire-test" ] && cp "$HERE/snull-wire-test" "$WORK/root/bin/"
+chmod +x "$WORK/root/init"
+: > "$WORK/root/bench.conf"
+for v in SIZES COUNT LAT_RATE LAT_COUNT MODARGS; do
+    eval "val=\${$v+set}"
+    [ "$val" = set ] && eval "echo $v=\\\"\$$v\\\"" >> "$WORK/root/bench.conf"
+done
+(cd "$WORK/root" && find . | cpio -o -H newc --quiet | gzip) > "$WORK/initrd.gz"
+
+ACCEL=
+[ -w /dev/kvm ] && ACCEL="-enable-kvm -cpu host"
+
+timeout "$TIMEOUT" "$QEMU" $ACCEL -smp "$SMP" -m "$MEM" \
+    -kernel "$KERNEL" -initrd "$WORK/initrd.gz" \
+    -append "console=ttyS0 panic=-1 quiet" \
+    -nographic -no-reboot -net none > "$LOG" 2>&1 || true
+
+tr -d '\r' < "$LOG" |
+    sed -n '/^SNULL-BENCH-BEGIN$/,/^SNULL-BENCH-END$/p' |
+    sed '1d;$d' > "$REPORT"
+if [ ! -s "$REPORT" ]; then
+    echo "$0: no report, see $LOG" >&2
+    exit 1
+fi
+echo "$REPORT"
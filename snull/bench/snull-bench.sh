@@ -0,0 +1,107 @@
+#!/bin/sh
+#
+# snull-bench.sh -- the snull throughput/latency suite
+#
+# Runs as init of the QEMU guest that qemu-bench.sh boots, but works on
+# any box that has snull.ko at hand and debugfs in the kernel. Every
+# run hands COUNT frames of one size to the generator of sn0 and reads
+# back snull/gen_report; the results go to stdout as one JSON document
+# between the SNULL-BENCH-BEGIN and SNULL-BENCH-END lines.
+#
+#   throughput   as fast as the queue takes them, for each of SIZES
+#   latency      at LAT_RATE frames a second, well below saturation
+#
+# Settings are read from /bench.conf when there is one.
+
+SIZES="64 512 1500"
+COUNT=1000000
+LAT_RATE=100000
+LAT_COUNT=200000
+MODULE=/snull.ko
+MODARGS=""
+
+[ -r /bench.conf ] && . /bench.conf
+
+D=/sys/kernel/debug/snull
+
+if [ $$ -eq 1 ]; then
+    /bin/busybox --install -s /bin
+    export PATH=/bin
+    mount -t proc proc /proc
+    mount -t sysfs sysfs /sys
+    mount -t debugfs debugfs /sys/kernel/debug
+    mount -t devtmpfs devtmpfs /dev
+fi
+
+die() {
+    echo "snull-bench: $*" >&2
+    [ $$ -eq 1 ] && poweroff -f
+    exit 1
+}
+
+# one generator run: type, size, rate, count
+run() {
+    echo "$4" > $D/sn0/gen_count
+    echo "$2" > $D/sn0/gen_size
+    echo "$3" > $D/sn0/gen_rate
+    echo 1 > $D/sn0/gen || die "generator would not start"
+    while [ "$(cat $D/sn0/gen)" != 0 ]; do
+        sleep 1
+    done
+    sleep 1                     # let the last frames land
+    awk -v type="$1" -v size="$2" -v rate="$3" '
+        $1 == "sent"     { sent = $2 }
+        $1 == "received" { rx = $2; bytes = $4; ns = $7 }
+        $1 == "rate"     { pps = $2; gbps = $4 }
+        $1 == "latency"  { p50 = $3; p99 = $6; p999 = $9; max = $12 }
+        END {
+            printf "    {\"type\": \"%s\", \"size\": %d, \"rate\": %d, ", \
+                type, size, rate
+            printf "\"sent\": %d, \"received\": %d, \"bytes\": %d, ", \
+                sent, rx, bytes
+            printf "\"ns\": %d, \"pps\": %d, \"gbps\": %s, ", \
+                ns, pps, gbps == "" ? "0" : gbps
+            printf "\"p50_ns\": %d, \"p99_ns\": %d, \"p999_ns\": %d, ", \
+                p50, p99, p999
+            printf "\"max_ns\": %d}", max
+        }' $D/gen_report
+}
+
+insmod $MODULE $MODARGS || die "insmod $MODULE failed"
+ip addr add 192.168.0.1/24 dev sn0
+ip addr add 192.168.1.2/24 dev sn1
+ip link set sn0 up
+ip link set sn1 up
+[ -d $D/sn0 ] || die "no $D/sn0, is debugfs in the kernel?"
+
+# the shared-memory wire, before the suite: attach, mmap, kick, reply
+WIRE=skipped
+if command -v snull-wire-test > /dev/null; then
+    snull-wire-test sn1 192.168.1.2 >&2 && WIRE=ok || WIRE=failed
+fi
+
+echo SNULL-BENCH-BEGIN
+echo "{"
+echo "  \"kernel\": \"$(uname -r)\","
+echo "  \"cpus\": $(grep -c ^processor /proc/cpuinfo),"
+echo "  \"modargs\": \"$MODARGS\","
+echo "  \"wire_test\": \"$WIRE\","
+echo "  \"runs\": ["
+sep=""
+for size in $SIZES; do
+    printf "$sep"
+    run throughput $size 0 $COUNT
+    sep=",\n"
+done
+for size in $SIZES; do
+    printf "$sep"
+    run latency $size $LAT_RATE $LAT_COUNT
+done
+printf "\n  ]\n}\n"
+echo SNULL-BENCH-END
+
+ip link set sn0 down
+ip link set sn1 down
+rmmod snull
+[ $$ -eq 1 ] && poweroff -f
+exit 0
@@ -0,0 +1,151 @@
+/*
+ * snull-wire-test.c -- check /dev/snull_wire from user space
+ *
+ *   snull-wire-test [ifname [ipaddr]]      (sn1 and 192.168.1.2)
+ *
+ * Opens and closes the device unattached, attaches to ifname, maps the
+ * rings, kicks an ARP request for ipaddr into the device and waits for
+ * the reply to come back on the rx ring. The device must be up and own
+ * ipaddr. Prints "wire ok" and exits 0, or says which step failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <net/if_arp.h>
+#include <netinet/if_ether.h>
+
+#include "../snull.h"
+
+#define WIRE        "/dev/snull_wire"
+#define RING_SIZE   64
+#define BUF_SIZE    2048
+
+static int fail(const char *step)
+{
+    printf("wire FAIL %s: %s\n", step, strerror(errno));
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *ifname = argc > 1 ? argv[1] : "sn1";
+    const char *ipaddr = argc > 2 ? argv[2] : "192.168.1.2";
+    static const unsigned char ours[ETH_ALEN] = { 0x02, 0, 0, 0, 0, 0x01 };
+    struct snull_wire_req req;
+    struct snull_wire_ring *rx, *tx;
+    struct ether_arp *arp;
+    struct ether_header *eth;
+    struct pollfd pfd;
+    unsigned char *mem, *frame;
+    struct in_addr tip;
+    uint32_t off;
+    int fd, fd2;
+
+    if (inet_pton(AF_INET, ipaddr, &tip) != 1) {
+        errno = EINVAL;
+        return fail("ipaddr");
+    }
+
+    /* a file that never attaches must open, refuse use, and close */
+    fd = open(WIRE, O_RDWR);
+    if (fd < 0)
+        return fail("open");
+    if (ioctl(fd, SNULL_WIRE_KICK) != -1 || errno != ENODEV)
+        return fail("kick before attach");
+    if (mmap(NULL, 4096, PROT_READ, MAP_SHARED, fd, 0) != MAP_FAILED ||
+            errno != ENODEV)
+        return fail("mmap before attach");
+    close(fd);
+
+    fd = open(WIRE, O_RDWR);
+    if (fd < 0)
+        return fail("reopen");
+    memset(&req, 0, sizeof(req));
+    strncpy(req.ifname, ifname, sizeof(req.ifname) - 1);
+    req.ring_size = RING_SIZE;
+    req.buf_size = BUF_SIZE;
+    if (ioctl(fd, SNULL_WIRE_ATTACH, &req) < 0)
+        return fail("attach");
+    if (ioctl(fd, SNULL_WIRE_ATTACH, &req) != -1 || errno != EBUSY)
+        return fail("second attach on the file");
+    fd2 = open(WIRE, O_RDWR);
+    if (fd2 < 0)
+        return fail("open second file");
+    if (ioctl(fd2, SNULL_WIRE_ATTACH, &req) != -1 || errno != EBUSY)
+        return fail("second attach to the device");
+    close(fd2);
+
+    mem = mmap(NULL, req.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+        return fail("mmap");
+    rx = (struct snull_wire_ring *)(mem + req.rx_off);
+    tx = (struct snull_wire_ring *)(mem + req.tx_off);
+
+    /* who has ipaddr, from .1 of its /24, in the first tx buffer */
+    off = req.buf_off + RING_SIZE * req.buf_size;
+    frame = mem + off;
+    memset(frame, 0, ETH_ZLEN);
+    eth = (struct ether_header *)frame;
+    memset(eth->ether_dhost, 0xff, ETH_ALEN);
+    memcpy(eth->ether_shost, ours, ETH_ALEN);
+    eth->ether_type = htons(ETHERTYPE_ARP);
+    arp = (struct ether_arp *)(eth + 1);
+    arp->arp_hrd = htons(ARPHRD_ETHER);
+    arp->arp_pro = htons(ETHERTYPE_IP);
+    arp->arp_hln = ETH_ALEN;
+    arp->arp_pln = 4;
+    arp->arp_op = htons(ARPOP_REQUEST);
+    memcpy(arp->arp_sha, ours, ETH_ALEN);
+    memcpy(arp->arp_spa, &tip, 4);
+    arp->arp_spa[3] = 1;
+    memcpy(arp->arp_tpa, &tip, 4);
+
+    tx->desc[0].offset = off;
+    tx->desc[0].len = ETH_ZLEN;
+    __atomic_store_n(&tx->head, 1, __ATOMIC_RELEASE);
+    if (ioctl(fd, SNULL_WIRE_KICK) != 1)
+        return fail("kick");
+    if (__atomic_load_n(&tx->tail, __ATOMIC_ACQUIRE) != 1) {
+        errno = EPROTO;
+        return fail("tx tail");
+    }
+
+    /* the reply, and maybe other chatter: look for it */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        uint32_t head, tail = rx->tail;
+
+        if (poll(&pfd, 1, 2000) <= 0) {
+            errno = ETIMEDOUT;
+            return fail("arp reply");
+        }
+        head = __atomic_load_n(&rx->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++) {
+            struct snull_wire_desc *d = &rx->desc[tail & (RING_SIZE - 1)];
+
+            eth = (struct ether_header *)(mem + d->offset);
+            arp = (struct ether_arp *)(eth + 1);
+            if (d->len >= sizeof(*eth) + sizeof(*arp) &&
+                    eth->ether_type == htons(ETHERTYPE_ARP) &&
+                    arp->arp_op == htons(ARPOP_REPLY) &&
+                    !memcmp(arp->arp_spa, &tip, 4)) {
+                __atomic_store_n(&rx->tail, tail + 1, __ATOMIC_RELEASE);
+                munmap(mem, req.map_size);
+                close(fd);
+                printf("wire ok\n");
+                return 0;
+            }
+        }
+        __atomic_store_n(&rx->tail, tail, __ATOMIC_RELEASE);
+    }
+}
@@ -42,8 +42,62 @@
 /* Default timeout period */
 #define SNULL_TIMEOUT 5   /* In jiffies */
 
-extern struct net_device *snull_devs[];
+/* MTU range: anything IP can carry, so jumbo frames go in one piece */
+#define SNULL_MIN_MTU 68
+#define SNULL_MAX_MTU ETH_MAX_MTU
 
+/*
+ * Offloads: whatever the stack hands us is delivered as is, so
+ * multi-fragment and GSO skbs never need to be linearized or segmented
+ */
+#define SNULL_FEATURES (NETIF_F_HW_CSUM | NETIF_F_SG | NETIF_F_FRAGLIST | \
+                        NETIF_F_GSO_SOFTWARE | NETIF_F_HIGHDMA)
+
+/*
+ * The shared-memory wire, /dev/snull_wire. A process attaches to one
+ * device with SNULL_WIRE_ATTACH and mmap()s the area it describes, and
+ * from then on it is the other end of that device's wire: what the
+ * device sends lands in the rx ring, and what the process puts in the
+ * tx ring and kicks with SNULL_WIRE_KICK the device receives.
+ *
+ * Each ring is single producer, single consumer. The producer fills
+ * desc[head % ring_size] and then advances head, the consumer reads
+ * up to head and then advances tail; both indices run freely and wrap.
+ * A descriptor points at a frame within the mapping. The kernel fills
+ * the rx ring from the first ring_size buffers, the process is free to
+ * point its tx descriptors anywhere in the buffer area, the second
+ * ring_size buffers being meant for that.
+ */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+struct snull_wire_desc {
+    __u32 offset;       /* of the frame, from the start of the mapping */
+    __u32 len;
+};
+
+struct snull_wire_ring {
+    __u32 head;         /* written by the producer only */
+    __u32 flags;        /* SNULL_WIRE_NO_INTR, set by the consumer */
+    __u32 pad0[14];
+    __u32 tail;         /* written by the consumer only */
+    __u32 pad1[15];
+    struct snull_wire_desc desc[];
+};
 
+/* The consumer of the rx ring is busy polling: no eventfd signal */
+#define SNULL_WIRE_NO_INTR  0x0001
 
+struct snull_wire_req {
+    char  ifname[16];   /* in: the snull device */
+    __u32 ring_size;    /* in: slots per ring, a power of two */
+    __u32 buf_size;     /* in/out: bytes per buffer, rounded up */
+    __u32 rx_off;       /* out: offsets of the rings and buffers */
+    __u32 tx_off;
+    __u32 buf_off;
+    __u32 map_size;     /* out: the length to mmap() */
+};
 
+#define SNULL_WIRE_ATTACH       _IOWR('S', 0x01, struct snull_wire_req)
+#define SNULL_WIRE_KICK         _IO('S', 0x02)
+#define SNULL_WIRE_SET_EVENTFD  _IOW('S', 0x03, int)
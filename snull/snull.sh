@@ -1,3 +1,6 @@
-insmod ./snull_anuz.ko $*
+insmod ./snull.ko $*
 ifconfig sn0 local0
 ifconfig sn1 local1
+# the IPv6 twins: ping fd00::2 from sn0 to reach sn1
+ip -6 addr add fd00::1/64 dev sn0
+ip -6 addr add fd00:0:0:1::2/64 dev sn1
@@ -0,0 +1,50 @@
+/*
+ * snull_compat.h -- the kernel API differences snull.c builds across
+ *
+ * snull.c is written against the current API; what older kernels
+ * spell differently is mapped here, so that the driver itself only
+ * needs a version check where a whole feature comes or goes.
+ */
+
+#ifndef _SNULL_COMPAT_H
+#define _SNULL_COMPAT_H
+
+#include <linux/version.h>
+
+/*
+ * ndo_tx_timeout got the index of the stuck queue in 5.6; before
+ * that, any stopped queue may be the one.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+#define SNULL_TX_TIMEOUT_ARGS   struct net_device *dev, unsigned int txqueue
+#define SNULL_TX_TIMED_OUT(i)   ((i) == txqueue)
+#else
+#define SNULL_TX_TIMEOUT_ARGS   struct net_device *dev
+#define SNULL_TX_TIMED_OUT(i)   1
+#endif
+
+/* 6.1 dropped the weight from netif_napi_add() and gave it a new name */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,1,0)
+#define netif_napi_add_weight(dev, napi, poll, weight) \
+    netif_napi_add(dev, napi, poll, weight)
+#endif
+
+/* dev->dev_addr is read-only from 5.17, the helper came in 5.15 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,15,0)
+#define eth_hw_addr_set(dev, addr) \
+    memcpy((dev)->dev_addr, addr, ETH_ALEN)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,7,0)
+#define page_pool_put_full_page(pool, page, allow_direct) \
+    page_pool_put_page(pool, page, allow_direct)
+#endif
+
+/* __assign_str() finds the source by itself from 6.10 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,10,0)
+#define snull_assign_str(dst, src)  __assign_str(dst)
+#else
+#define snull_assign_str(dst, src)  __assign_str(dst, src)
+#endif
+
+#endif /* _SNULL_COMPAT_H */
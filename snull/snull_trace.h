@@ -0,0 +1,213 @@
+/*
+ * snull_trace.h -- tracepoints for the snull data path
+ *
+ * They replace the per-packet printk()s: when a tracepoint is not
+ * enabled it costs a patched-out branch, and when it is the IP tuple
+ * is only formatted when the trace buffer is read.
+ *
+ *   echo 1 > /sys/kernel/debug/tracing/events/snull/enable
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM snull
+
+#if !defined(_SNULL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SNULL_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/netdevice.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+
+#include "snull_compat.h"
+
+DECLARE_EVENT_CLASS(snull_packet_class,
+
+    TP_PROTO(const struct net_device *dev, u16 queue, unsigned int len),
+
+    TP_ARGS(dev, queue, len),
+
+    TP_STRUCT__entry(
+        __string(name, dev->name)
+        __field(u16, queue)
+        __field(unsigned int, len)
+    ),
+
+    TP_fast_assign(
+        snull_assign_str(name, dev->name);
+        __entry->queue = queue;
+        __entry->len = len;
+    ),
+
+    TP_printk("dev=%s queue=%u len=%u",
+        __get_str(name), __entry->queue, __entry->len)
+);
+
+/* The stack hands a frame to snull_tx() */
+DEFINE_EVENT(snull_packet_class, snull_tx,
+    TP_PROTO(const struct net_device *dev, u16 queue, unsigned int len),
+    TP_ARGS(dev, queue, len)
+);
+
+/* A frame is delivered to the stack on the receiving device */
+DEFINE_EVENT(snull_packet_class, snull_rx,
+    TP_PROTO(const struct net_device *dev, u16 queue, unsigned int len),
+    TP_ARGS(dev, queue, len)
+);
+
+/* An IPv4 frame put on the wire, with its tuple before the rewrite */
+TRACE_EVENT(snull_hw_tx,
+
+    TP_PROTO(const struct net_device *dev, u16 queue,
+             const struct iphdr *ih, __be16 source, __be16 dest,
+             unsigned int len),
+
+    TP_ARGS(dev, queue, ih, source, dest, len),
+
+    TP_STRUCT__entry(
+        __string(name, dev->name)
+        __field(u16, queue)
+        __field(unsigned int, len)
+        __field(__be32, saddr)
+        __field(__be32, daddr)
+        __field(__be16, source)
+        __field(__be16, dest)
+    ),
+
+    TP_fast_assign(
+        snull_assign_str(name, dev->name);
+        __entry->queue = queue;
+        __entry->len = len;
+        __entry->saddr = ih->saddr;
+        __entry->daddr = ih->daddr;
+        __entry->source = source;
+        __entry->dest = dest;
+    ),
+
+    TP_printk("dev=%s queue=%u len=%u %pI4:%u --> %pI4:%u",
+        __get_str(name), __entry->queue, __entry->len,
+        &__entry->saddr, ntohs(__entry->source),
+        &__entry->daddr, ntohs(__entry->dest))
+);
+
+/* The same for IPv6 */
+TRACE_EVENT(snull_hw_tx6,
+
+    TP_PROTO(const struct net_device *dev, u16 queue,
+             const struct ipv6hdr *ih, __be16 source, __be16 dest,
+             unsigned int len),
+
+    TP_ARGS(dev, queue, ih, source, dest, len),
+
+    TP_STRUCT__entry(
+        __string(name, dev->name)
+        __field(u16, queue)
+        __field(unsigned int, len)
+        __array(u8, saddr, sizeof(struct in6_addr))
+        __array(u8, daddr, sizeof(struct in6_addr))
+        __field(__be16, source)
+        __field(__be16, dest)
+    ),
+
+    TP_fast_assign(
+        snull_assign_str(name, dev->name);
+        __entry->queue = queue;
+        __entry->len = len;
+        memcpy(__entry->saddr, &ih->saddr, sizeof(struct in6_addr));
+        memcpy(__entry->daddr, &ih->daddr, sizeof(struct in6_addr));
+        __entry->source = source;
+        __entry->dest = dest;
+    ),
+
+    TP_printk("dev=%s queue=%u len=%u [%pI6c]:%u --> [%pI6c]:%u",
+        __get_str(name), __entry->queue, __entry->len,
+        __entry->saddr, ntohs(__entry->source),
+        __entry->daddr, ntohs(__entry->dest))
+);
+
+/* Any other frame put on the wire, which goes as it is */
+TRACE_EVENT(snull_hw_tx_raw,
+
+    TP_PROTO(const struct net_device *dev, u16 queue, __be16 proto,
+             unsigned int len),
+
+    TP_ARGS(dev, queue, proto, len),
+
+    TP_STRUCT__entry(
+        __string(name, dev->name)
+        __field(u16, queue)
+        __field(unsigned int, len)
+        __field(__be16, proto)
+    ),
+
+    TP_fast_assign(
+        snull_assign_str(name, dev->name);
+        __entry->queue = queue;
+        __entry->len = len;
+        __entry->proto = proto;
+    ),
+
+    TP_printk("dev=%s queue=%u len=%u proto=0x%04x",
+        __get_str(name), __entry->queue, __entry->len,
+        ntohs(__entry->proto))
+);
+
+/* End of a NAPI poll */
+TRACE_EVENT(snull_poll,
+
+    TP_PROTO(const struct net_device *dev, u16 queue, int work, int budget),
+
+    TP_ARGS(dev, queue, work, budget),
+
+    TP_STRUCT__entry(
+        __string(name, dev->name)
+        __field(u16, queue)
+        __field(int, work)
+        __field(int, budget)
+    ),
+
+    TP_fast_assign(
+        snull_assign_str(name, dev->name);
+        __entry->queue = queue;
+        __entry->work = work;
+        __entry->budget = budget;
+    ),
+
+    TP_printk("dev=%s queue=%u work=%d budget=%d",
+        __get_str(name), __entry->queue, __entry->work, __entry->budget)
+);
+
+/* A frame lost on either side, and why */
+TRACE_EVENT(snull_drop,
+
+    TP_PROTO(const struct net_device *dev, u16 queue, unsigned int len,
+             const char *reason),
+
+    TP_ARGS(dev, queue, len, reason),
+
+    TP_STRUCT__entry(
+        __string(name, dev->name)
+        __field(u16, queue)
+        __field(unsigned int, len)
+        __string(reason, reason)
+    ),
+
+    TP_fast_assign(
+        snull_assign_str(name, dev->name);
+        __entry->queue = queue;
+        __entry->len = len;
+        snull_assign_str(reason, reason);
+    ),
+
+    TP_printk("dev=%s queue=%u len=%u reason=%s",
+        __get_str(name), __entry->queue, __entry->len, __get_str(reason))
+);
+
+#endif /* _SNULL_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE snull_trace
+#include <trace/define_trace.h>
@@ -1,3 +1,3 @@
 ifconfig sn0 down
 ifconfig sn1 down
-rmmod snull_anuz
+rmmod snull